@@ -62,6 +62,20 @@ It goes back to 1 automatically until it ends
 //  PCLKB is running off system clock / 2
 #define CTSU_BASE_FREQ 24000.0
 
+// TSCAP discharge time.  The pin driver is tens of ohms, so even a 100nF
+// cap has a time constant of only a few microseconds.  100us is well over
+// ten time constants.
+#define TSCAP_DISCHARGE_HOLD_US 100
+
+// The unit is considered stable once the reference counts of every channel
+// stay within 1/32 of the last frame for this many frames in a row.
+#define CTSU_READY_STABLE_FRAMES 3
+
+#define CTSU_GANG_DEFAULT_INTERVAL_MS 100
+
+// fewest repeated readings the self-test will call stuck
+#define CTSU_SELFTEST_MIN_STUCK_FRAMES 4
+
 #if defined(ARDUINO_UNOR4_MINIMA)
 
 #define LOVE_PORT 2
@@ -121,7 +135,8 @@ const ctsu_pin_info_t g_ctsu_pin_info[NUM_ARDUINO_PINS] = {
 
 #endif
 
-uint8_t dataIndexToTS[NUM_CTSU_PINS];
+// bit n is set when TSn is enabled.  Data indexes follow TS order.
+uint64_t ts_bitmap = 0;
 uint8_t pinToDataIndex[NUM_ARDUINO_PINS] = {NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN,
                                             NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN,
                                             NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN, NOT_A_TOUCH_PIN,
@@ -134,9 +149,56 @@ uint16_t regSettings[NUM_CTSU_PINS][3];
 int num_configured_sensors = 0;
 bool free_running = true;
 volatile bool ctsu_done = true;
+bool ctsu_stable = false;
+bool ctsu_ready_checked = false;
+volatile bool ctsu_warming_up = false;
 
 fn_callback_ptr_t ctsu_fn_callback = nullptr;
 
+struct ctsu_callback_entry_t
+{
+  fn_ctx_callback_ptr_t cb;
+  void *ctx;
+  ctsu_callback_mode_t mode;
+};
+
+ctsu_callback_entry_t ctsu_callbacks[MAX_CTSU_CALLBACKS];
+// one bit per entry in ctsu_callbacks
+volatile uint32_t ctsu_deferred_pending = 0;
+uint32_t ctsu_deferred_mask = 0;
+
+// Ganged proximity profile.  The gang channels are scanned with one set of
+// coarse settings and their counts summed into a single value.
+uint64_t gang_bitmap = 0;
+int num_gang_sensors = 0;
+// Default is half the clock div of a new pin, so each gang measurement is about
+// twice as short at lower resolution.  Summing the gang makes up the lost signal.
+ctsu_pin_settings_t gang_settings = {CTSU_CLOCK_DIV_16, CTSU_ICO_GAIN_100, 0, 0, 1};
+uint16_t gangRegSettings[NUM_CTSU_PINS][3];
+uint16_t gangResults[NUM_CTSU_PINS][2];
+uint32_t gang_threshold = 0;
+uint32_t gang_interval = CTSU_GANG_DEFAULT_INTERVAL_MS;
+unsigned long gang_last_scan = 0;
+volatile uint32_t gang_value = 0;
+volatile bool gang_mode = false;
+volatile bool gang_triggered = false;
+
+// Fault diagnostics.  Per channel state is kept by data index and moves
+// with regSettings when pins are added or removed.  Faults of the unit as a
+// whole (timeouts, never settling) are kept apart and apply to every channel.
+bool diag_enabled = false;
+ctsu_diag_limits_t diag_limits = {CTSU_DIAG_DEFAULT_MIN_COUNT, CTSU_DIAG_DEFAULT_MAX_COUNT,
+                                  CTSU_DIAG_DEFAULT_MIN_RATIO, CTSU_DIAG_DEFAULT_MAX_RATIO,
+                                  CTSU_DIAG_DEFAULT_STUCK_FRAMES, CTSU_DIAG_DEFAULT_SCAN_TIMEOUT_MS};
+volatile uint8_t diag_faults[NUM_CTSU_PINS];
+volatile uint8_t diag_unit_faults = CTSU_FAULT_NONE;
+uint8_t diag_reported[NUM_CTSU_PINS];
+uint16_t diag_last[NUM_CTSU_PINS];
+uint16_t diag_same_count[NUM_CTSU_PINS];
+fn_fault_callback_ptr_t diag_fault_callback = nullptr;
+volatile bool ctsu_scan_active = false;
+volatile unsigned long ctsu_scan_start = 0;
+
 dtc_instance_ctrl_t wr_ctrl;
 transfer_info_t wr_info;
 dtc_extended_cfg_t wr_ext;
@@ -151,6 +213,11 @@ static void initialize_CTSU();
 static void initialize_DTC();
 
 static void startCTSUmeasure();
+static void writeChannelEnable(const uint64_t);
+static void settingsToRegs(const ctsu_pin_settings_t &, uint16_t *);
+static void resetDiagnostics();
+static void checkTouchFrame(const uint16_t);
+static void latchUnitFaults(const uint8_t);
 
 // extern bool wr_fired;
 void CTSUWR_handler()
@@ -180,23 +247,182 @@ void CTSUFN_handler()
   IRQn_Type irq = R_FSP_CurrentIrqGet();
   R_BSP_IrqStatusClear(irq);
   ctsu_done = true;
+  ctsu_scan_active = false;
+  if (ctsu_warming_up)
+  {
+    // warm-up frames from waitForTouchReady are not passed on
+    return;
+  }
+  if (gang_mode)
+  {
+    uint32_t sum = 0;
+    for (int i = 0; i < num_gang_sensors; i++)
+    {
+      sum += gangResults[i][0];
+    }
+    gang_value = sum;
+    if (sum > gang_threshold)
+    {
+      // approach detected.  Swap to the full scan of the individual channels.
+      gang_mode = false;
+      gang_triggered = true;
+      writeChannelEnable(ts_bitmap);
+      free_running = true;
+      startCTSUmeasure();
+    }
+    // otherwise serviceTouchGang() starts the next coarse scan
+    return;
+  }
+  if (diag_enabled)
+  {
+    checkTouchFrame(diag_limits.stuck_frames);
+  }
   if (ctsu_fn_callback)
   {
     ctsu_fn_callback();
   }
+  for (int i = 0; i < MAX_CTSU_CALLBACKS; i++)
+  {
+    if (ctsu_callbacks[i].cb && (ctsu_callbacks[i].mode == CTSU_CALLBACK_IMMEDIATE))
+    {
+      ctsu_callbacks[i].cb(ctsu_callbacks[i].ctx);
+    }
+  }
+  // deferred ones just get flagged.  Frames that end before the
+  // next service call are merged into one call.
+  ctsu_deferred_pending |= ctsu_deferred_mask;
   if (free_running)
   {
     startCTSUmeasure();
   }
 }
 
+bool isTouchModePin(const uint8_t pin)
+{
+  return ((pin < NUM_ARDUINO_PINS) && (pinToDataIndex[pin] != NOT_A_TOUCH_PIN));
+}
+
 bool touchMeasurementReady()
 {
   return (free_running || ctsu_done);
 }
 
+// Waits for the scan in progress.  Returns false and aborts the scan
+// if it doesn't finish by timeout_ms after start.
+static bool waitForScan(const unsigned long start, const uint32_t timeout_ms)
+{
+  while (!ctsu_done)
+  {
+    if (millis() - start >= timeout_ms)
+    {
+      // the scan never finished
+      R_CTSU->CTSUCR0 = 0x10;
+      ctsu_scan_active = false;
+      ctsu_done = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Runs one scan of the normal profile and waits for it.
+static bool scanAndWait(const unsigned long start, const uint32_t timeout_ms)
+{
+  startCTSUmeasure();
+  return waitForScan(start, timeout_ms);
+}
+
+bool waitForTouchMeasurement()
+{
+  if (free_running)
+  {
+    // results are always fresh
+    return true;
+  }
+  if (!waitForScan(ctsu_scan_start, diag_limits.scan_timeout_ms))
+  {
+    latchUnitFaults(CTSU_FAULT_TIMEOUT);
+    return false;
+  }
+  return true;
+}
+
+bool waitForTouchReady(const uint32_t timeout_ms /*= CTSU_READY_TIMEOUT_MS*/)
+{
+  if (ctsu_stable)
+  {
+    return true;
+  }
+  if (num_configured_sensors == 0)
+  {
+    // nothing to measure with
+    return false;
+  }
+  ctsu_ready_checked = true;
+  bool fr = free_running;
+  stopTouchMeasurement();
+  ctsu_warming_up = true;
+
+  uint16_t lastRef[NUM_CTSU_PINS] = {0};
+  int stableFrames = 0;
+  bool first = true;
+  bool timedOut = false;
+  unsigned long start = millis();
+  while (!ctsu_stable && (millis() - start < timeout_ms))
+  {
+    if (!scanAndWait(start, timeout_ms))
+    {
+      timedOut = true;
+      break;
+    }
+    bool settled = !first;
+    for (int i = 0; i < num_configured_sensors; i++)
+    {
+      uint16_t ref = results[i][1];
+      uint16_t diff = (ref > lastRef[i]) ? (ref - lastRef[i]) : (lastRef[i] - ref);
+      if (diff > (lastRef[i] >> 5))
+      {
+        settled = false;
+      }
+      lastRef[i] = ref;
+    }
+    first = false;
+    stableFrames = settled ? stableFrames + 1 : 0;
+    if (stableFrames >= CTSU_READY_STABLE_FRAMES)
+    {
+      ctsu_stable = true;
+    }
+  }
+  if (!ctsu_stable)
+  {
+    // never settling is what a missing TSCAP capacitor usually looks like
+    latchUnitFaults(timedOut ? CTSU_FAULT_TIMEOUT : CTSU_FAULT_UNSTABLE);
+  }
+
+  ctsu_warming_up = false;
+  free_running = fr;
+  if (fr)
+  {
+    // it was running before, so leave it running
+    startCTSUmeasure();
+  }
+  return ctsu_stable;
+}
+
 void startTouchMeasurement(bool fr /*= true*/)
 {
+  if (!ctsu_ready_checked)
+  {
+    // first start after power on takes the place of the old fixed delays.
+    // The scan is started below, so waitForTouchReady shouldn't restart it.
+    free_running = false;
+    waitForTouchReady();
+  }
+  if (gang_mode)
+  {
+    // leave the coarse scan
+    stopTouchMeasurement();
+  }
   free_running = fr;
   if (ctsu_done || ((R_CTSU->CTSUST & 7) == 0))
   {
@@ -207,6 +433,15 @@ void startTouchMeasurement(bool fr /*= true*/)
 static void startCTSUmeasure()
 {
   ctsu_done = false;
+  ctsu_scan_active = true;
+  ctsu_scan_start = millis();
+  if (gang_mode)
+  {
+    R_DTC_Reset(&wr_ctrl, &(gangRegSettings[0][0]), (void *)&(R_CTSU->CTSUSSC), num_gang_sensors);
+    R_DTC_Reset(&rd_ctrl, (void *)&(R_CTSU->CTSUSC), &(gangResults[0][0]), num_gang_sensors);
+    R_CTSU->CTSUCR0 = 1;
+    return;
+  }
   R_DTC_Reset(&wr_ctrl, &(regSettings[0][0]), (void *)&(R_CTSU->CTSUSSC), num_configured_sensors);
   R_DTC_Reset(&rd_ctrl, (void *)&(R_CTSU->CTSUSC), &(results[0][0]), num_configured_sensors);
   R_CTSU->CTSUCR0 = 1;
@@ -216,10 +451,63 @@ void stopTouchMeasurement()
 {
   R_CTSU->CTSUCR0 = 0x10;
   free_running = false;
+  ctsu_scan_active = false;
+  if (gang_mode)
+  {
+    gang_mode = false;
+    writeChannelEnable(ts_bitmap);
+  }
+}
+
+// sets CTSUCHAC from the pin table for every TS number set in the bitmap
+static void writeChannelEnable(const uint64_t bitmap)
+{
+  uint8_t chac[5] = {0, 0, 0, 0, 0};
+  for (int i = 0; i < NUM_ARDUINO_PINS; i++)
+  {
+    const ctsu_pin_info_t *info = &(g_ctsu_pin_info[i]);
+    if ((info->ts_num != NOT_A_TOUCH_PIN) && (bitmap & (1ULL << info->ts_num)))
+    {
+      chac[info->chac_idx] |= info->chac_val;
+    }
+  }
+  for (int i = 0; i < 5; i++)
+  {
+    R_CTSU->CTSUCHAC[i] = chac[i];
+  }
+}
+
+// data index of a TS number is the count of enabled TS numbers below it
+static inline uint8_t tsToDataIndex(const uint8_t ts)
+{
+  return __builtin_popcountll(ts_bitmap & ((1ULL << ts) - 1));
+}
+
+// one pass over the pins to bring the lookup table and CHAC in line with the bitmap
+static void rebuildSensorTables()
+{
+  for (int i = 0; i < NUM_ARDUINO_PINS; i++)
+  {
+    uint8_t ts = g_ctsu_pin_info[i].ts_num;
+    if ((ts != NOT_A_TOUCH_PIN) && (ts_bitmap & (1ULL << ts)))
+    {
+      pinToDataIndex[i] = tsToDataIndex(ts);
+    }
+    else
+    {
+      pinToDataIndex[i] = NOT_A_TOUCH_PIN;
+    }
+  }
+  writeChannelEnable(ts_bitmap);
+  num_configured_sensors = __builtin_popcountll(ts_bitmap);
 }
 
 bool setTouchMode(const uint8_t pin)
 {
+  if (pin >= NUM_ARDUINO_PINS)
+  {
+    return false;
+  }
   // find the pin info:
   const ctsu_pin_info_t *info = &(g_ctsu_pin_info[pin]);
   if (info->ts_num == NOT_A_TOUCH_PIN)
@@ -227,7 +515,7 @@ bool setTouchMode(const uint8_t pin)
     // pin is not supported
     return false;
   }
-  if (pinToDataIndex[pin] != NOT_A_TOUCH_PIN)
+  if (ts_bitmap & (1ULL << info->ts_num))
   {
     // pin is already configured.
     return false;
@@ -247,48 +535,74 @@ bool setTouchMode(const uint8_t pin)
 
   initialize_CTSU();
 
+  // open a slot in the settings at this pin's place in TS order
+  uint8_t di = tsToDataIndex(info->ts_num);
+  memmove(&(regSettings[di + 1][0]), &(regSettings[di][0]), (num_configured_sensors - di) * sizeof(regSettings[0]));
+  // results move with them so the other pins read their own data until the next scan
+  memmove(&(results[di + 1][0]), &(results[di][0]), (num_configured_sensors - di) * sizeof(results[0]));
+  results[di][0] = 0;
+  results[di][1] = 0;
+  // as does the fault state.  The new slot starts out healthy.
+  memmove((void *)&(diag_faults[di + 1]), (void *)&(diag_faults[di]), (num_configured_sensors - di) * sizeof(diag_faults[0]));
+  memmove(&(diag_reported[di + 1]), &(diag_reported[di]), (num_configured_sensors - di) * sizeof(diag_reported[0]));
+  memmove(&(diag_last[di + 1]), &(diag_last[di]), (num_configured_sensors - di) * sizeof(diag_last[0]));
+  memmove(&(diag_same_count[di + 1]), &(diag_same_count[di]), (num_configured_sensors - di) * sizeof(diag_same_count[0]));
+  diag_faults[di] = CTSU_FAULT_NONE;
+  diag_reported[di] = CTSU_FAULT_NONE;
+  diag_last[di] = 0;
+  diag_same_count[di] = 0;
+  regSettings[di][0] = 0x0200;
+  regSettings[di][1] = 0;
+  regSettings[di][2] = 0x0F00;
+
   // add to the list of enabled pins
-  R_CTSU->CTSUCHAC[info->chac_idx] |= info->chac_val;
+  ts_bitmap |= (1ULL << info->ts_num);
+  rebuildSensorTables();
+  return true;
+}
 
-  // figure out the index in the data array for this pin
-  int di = 0;
-  for (int i = num_configured_sensors; i > 0; i--)
+bool clearTouchMode(const uint8_t pin)
+{
+  if ((pin >= NUM_ARDUINO_PINS) || (pinToDataIndex[pin] == NOT_A_TOUCH_PIN))
   {
-    if (dataIndexToTS[i - 1] < info->ts_num)
-    {
-      di = i;
-      break;
-    }
-    else
-    {
-      // shift the array over one space
-      dataIndexToTS[i] = dataIndexToTS[i - 1];
-      memcpy(&(regSettings[0][0]) + (3 * i), &(regSettings[0][0]) + (3 * (i - 1)), 6);
-    }
+    // not a configured touch pin
+    return false;
   }
-  // fix the other pin indexes
-  if (di < num_configured_sensors)
+  const ctsu_pin_info_t *info = &(g_ctsu_pin_info[pin]);
+  // stop CTSU if it is running
+  stopTouchMeasurement();
+
+  // close up the slot this pin had in the settings
+  uint8_t di = pinToDataIndex[pin];
+  memmove(&(regSettings[di][0]), &(regSettings[di + 1][0]), (num_configured_sensors - di - 1) * sizeof(regSettings[0]));
+  memmove(&(results[di][0]), &(results[di + 1][0]), (num_configured_sensors - di - 1) * sizeof(results[0]));
+  memmove((void *)&(diag_faults[di]), (void *)&(diag_faults[di + 1]), (num_configured_sensors - di - 1) * sizeof(diag_faults[0]));
+  memmove(&(diag_reported[di]), &(diag_reported[di + 1]), (num_configured_sensors - di - 1) * sizeof(diag_reported[0]));
+  memmove(&(diag_last[di]), &(diag_last[di + 1]), (num_configured_sensors - di - 1) * sizeof(diag_last[0]));
+  memmove(&(diag_same_count[di]), &(diag_same_count[di + 1]), (num_configured_sensors - di - 1) * sizeof(diag_same_count[0]));
+
+  // remove from the list of enabled pins
+  ts_bitmap &= ~(1ULL << info->ts_num);
+  rebuildSensorTables();
+  // and from the gang.  The gang settings are all the same so nothing moves.
+  gang_bitmap &= ts_bitmap;
+  num_gang_sensors = __builtin_popcountll(gang_bitmap);
+
+  // give the pin back as a plain input
+  if (pin == NUM_ARDUINO_PINS - 1)
   {
-    for (int i = 0; i < NUM_ARDUINO_PINS; i++)
-    {
-      if ((pinToDataIndex[i] != 255) && pinToDataIndex[i] >= di)
-      {
-        pinToDataIndex[i]++;
-      }
-    }
+    R_PFS->PORT[LOVE_PORT].PIN[LOVE_PIN].PmnPFS = 0;
+  }
+  else
+  {
+    R_IOPORT_PinCfg(&g_ioport_ctrl, g_pin_cfg[pin].pin, (uint32_t)IOPORT_CFG_PORT_DIRECTION_INPUT);
   }
-  dataIndexToTS[di] = info->ts_num;
-  regSettings[di][0] = 0x0200;
-  regSettings[di][1] = 0;
-  regSettings[di][2] = 0x0F00;
-  pinToDataIndex[pin] = di;
-  num_configured_sensors++;
   return true;
 }
 
 uint16_t touchRead(const uint8_t pin)
 {
-  if (pinToDataIndex[pin] == NOT_A_TOUCH_PIN)
+  if (!isTouchModePin(pin))
   {
     return 0;
   }
@@ -297,7 +611,7 @@ uint16_t touchRead(const uint8_t pin)
 
 uint16_t touchReadReference(const uint8_t pin)
 {
-  if (pinToDataIndex[pin] == NOT_A_TOUCH_PIN)
+  if (!isTouchModePin(pin))
   {
     return 0;
   }
@@ -314,7 +628,7 @@ static void initialize_CTSU()
     // Follow the flow chart Fig 41.9
     // Step 1: Discharge LPF (set TSCAP as OUTPUT LOW.)
     R_PFS->PORT[1].PIN[12].PmnPFS = (1 << R_PFS_PORT_PIN_PmnPFS_PDR_Pos);
-    delay(100);
+    delayMicroseconds(TSCAP_DISCHARGE_HOLD_US);
 
     // Step 2: Setup I/O port PmnPFR registers
 
@@ -338,7 +652,8 @@ static void initialize_CTSU()
     R_CTSU->CTSUCR1 |= 0x40; // set for multiscan mode
 
     // Step 7: Wait for stabilization (Whatever that means...)
-    delay(100);
+    // This is handled by waitForTouchReady() once there are channels
+    // to measure with.  See startTouchMeasurement().
 
     // setup other registers:
     R_CTSU->CTSUSDPRS = 0x23; // recommended settings with noise reduction on
@@ -436,9 +751,8 @@ static void initialize_DTC()
   R_DTC_Enable(&rd_ctrl);
 }
 
-void setTouchPinClockDiv(const uint8_t aPin, const ctsu_clock_div_t aDiv)
+static uint16_t clockDivToSSC(const ctsu_clock_div_t aDiv)
 {
-  // calculate CTSUSSC settings from clock div
   uint16_t ssc = 0;
   double ctsu_freq = (CTSU_BASE_FREQ / (int)aDiv);
   if (ctsu_freq < 400.0)
@@ -481,6 +795,17 @@ void setTouchPinClockDiv(const uint8_t aPin, const ctsu_clock_div_t aDiv)
   {
     ssc = 1;
   }
+  return ssc;
+}
+
+void setTouchPinClockDiv(const uint8_t aPin, const ctsu_clock_div_t aDiv)
+{
+  if (!isTouchModePin(aPin))
+  {
+    return;
+  }
+  // calculate CTSUSSC settings from clock div
+  uint16_t ssc = clockDivToSSC(aDiv);
   // set the CTSUSSC register
   regSettings[pinToDataIndex[aPin]][0] = (ssc << 8);
   // setting for CTSUSO1
@@ -489,21 +814,37 @@ void setTouchPinClockDiv(const uint8_t aPin, const ctsu_clock_div_t aDiv)
 
 void setTouchPinIcoGain(const uint8_t aPin, const ctsu_ico_gain_t aGain)
 {
+  if (!isTouchModePin(aPin))
+  {
+    return;
+  }
   regSettings[pinToDataIndex[aPin]][2] = (regSettings[pinToDataIndex[aPin]][2] & ~(0x6000)) | ((uint16_t)aGain << 13);
 }
 
 void setTouchPinReferenceCurrent(const uint8_t aPin, const uint8_t aSet)
 {
+  if (!isTouchModePin(aPin))
+  {
+    return;
+  }
   regSettings[pinToDataIndex[aPin]][2] = (regSettings[pinToDataIndex[aPin]][2] & ~(0x00FF)) | (aSet);
 }
 
 void setTouchPinMeasurementCount(const uint8_t aPin, const uint8_t aCount)
 {
+  if (!isTouchModePin(aPin))
+  {
+    return;
+  }
   regSettings[pinToDataIndex[aPin]][1] = (regSettings[pinToDataIndex[aPin]][1] & ~(0xFC00)) | (((uint16_t)aCount - 1) << 10);
 }
 
 void setTouchPinSensorOffset(const uint8_t aPin, const uint16_t aOff)
 {
+  if (!isTouchModePin(aPin))
+  {
+    return;
+  }
   regSettings[pinToDataIndex[aPin]][1] = (regSettings[pinToDataIndex[aPin]][1] & ~(0x03FF)) | (aOff);
 }
 
@@ -516,9 +857,23 @@ void applyTouchPinSettings(const uint8_t pin, const ctsu_pin_settings_t &setting
   setTouchPinMeasurementCount(pin, settings.count);
 }
 
+static void settingsToRegs(const ctsu_pin_settings_t &settings, uint16_t *regs)
+{
+  // CTSUSSC
+  regs[0] = (clockDivToSSC(settings.div) << 8);
+  // CTSUSO0
+  regs[1] = (((uint16_t)settings.count - 1) << 10) | (settings.offset & 0x03FF);
+  // CTSUSO1
+  regs[2] = ((uint16_t)settings.gain << 13) | ((uint16_t)settings.div << 8) | settings.ref_current;
+}
+
 ctsu_pin_settings_t getTouchPinSettings(const uint8_t pin)
 {
-  ctsu_pin_settings_t ret;
+  ctsu_pin_settings_t ret = {};
+  if (!isTouchModePin(pin))
+  {
+    return ret;
+  }
   int idx = pinToDataIndex[pin];
   ret.div = static_cast<ctsu_clock_div_t>((regSettings[idx][2] >> 8) & 0x1F);
   ret.gain = static_cast<ctsu_ico_gain_t>(regSettings[idx][2] >> 13);
@@ -531,4 +886,340 @@ ctsu_pin_settings_t getTouchPinSettings(const uint8_t pin)
 void attachMeasurementEndCallback(fn_callback_ptr_t cb)
 {
   ctsu_fn_callback = cb;
-}
\ No newline at end of file
+}
+
+bool addMeasurementEndCallback(fn_ctx_callback_ptr_t cb, void *ctx, const ctsu_callback_mode_t mode)
+{
+  if (!cb)
+  {
+    return false;
+  }
+  int slot = -1;
+  for (int i = 0; i < MAX_CTSU_CALLBACKS; i++)
+  {
+    if ((ctsu_callbacks[i].cb == cb) && (ctsu_callbacks[i].ctx == ctx))
+    {
+      // already registered, just update the mode
+      slot = i;
+      break;
+    }
+    if ((slot < 0) && (ctsu_callbacks[i].cb == nullptr))
+    {
+      slot = i;
+    }
+  }
+  if (slot < 0)
+  {
+    // registry is full
+    return false;
+  }
+  noInterrupts();
+  ctsu_callbacks[slot].ctx = ctx;
+  ctsu_callbacks[slot].mode = mode;
+  ctsu_callbacks[slot].cb = cb;
+  if (mode == CTSU_CALLBACK_DEFERRED)
+  {
+    ctsu_deferred_mask |= (1ul << slot);
+  }
+  else
+  {
+    ctsu_deferred_mask &= ~(1ul << slot);
+    ctsu_deferred_pending &= ~(1ul << slot);
+  }
+  interrupts();
+  return true;
+}
+
+bool removeMeasurementEndCallback(fn_ctx_callback_ptr_t cb, void *ctx)
+{
+  for (int i = 0; i < MAX_CTSU_CALLBACKS; i++)
+  {
+    if ((ctsu_callbacks[i].cb == cb) && (ctsu_callbacks[i].ctx == ctx))
+    {
+      noInterrupts();
+      ctsu_callbacks[i].cb = nullptr;
+      ctsu_deferred_mask &= ~(1ul << i);
+      ctsu_deferred_pending &= ~(1ul << i);
+      interrupts();
+      return true;
+    }
+  }
+  return false;
+}
+
+void serviceTouchCallbacks()
+{
+  noInterrupts();
+  uint32_t pending = ctsu_deferred_pending;
+  ctsu_deferred_pending = 0;
+  interrupts();
+  for (int i = 0; pending; i++, pending >>= 1)
+  {
+    if (pending & 1)
+    {
+      // copy in case the entry is removed out from under us
+      fn_ctx_callback_ptr_t cb = ctsu_callbacks[i].cb;
+      if (cb)
+      {
+        cb(ctsu_callbacks[i].ctx);
+      }
+    }
+  }
+}
+
+bool setTouchGangPins(const uint8_t *pins, const uint8_t n)
+{
+  uint64_t bitmap = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if ((pins[i] >= NUM_ARDUINO_PINS) || (pinToDataIndex[pins[i]] == NOT_A_TOUCH_PIN))
+    {
+      // gang members must already be configured touch pins
+      return false;
+    }
+    bitmap |= (1ULL << g_ctsu_pin_info[pins[i]].ts_num);
+  }
+  stopTouchMeasurement();
+  gang_bitmap = bitmap;
+  num_gang_sensors = __builtin_popcountll(gang_bitmap);
+  setTouchGangSettings(gang_settings);
+  return true;
+}
+
+void setTouchGangSettings(const ctsu_pin_settings_t &settings)
+{
+  gang_settings = settings;
+  for (int i = 0; i < NUM_CTSU_PINS; i++)
+  {
+    settingsToRegs(gang_settings, gangRegSettings[i]);
+  }
+}
+
+void setTouchGangThreshold(const uint32_t thresh)
+{
+  gang_threshold = thresh;
+}
+
+void setTouchGangInterval(const uint32_t interval_ms)
+{
+  gang_interval = interval_ms;
+}
+
+bool startTouchGangScan()
+{
+  if ((num_gang_sensors == 0) || (gang_threshold == 0))
+  {
+    // with no threshold the first coarse frame would always trigger
+    return false;
+  }
+  if (!ctsu_ready_checked)
+  {
+    waitForTouchReady();
+  }
+  stopTouchMeasurement();
+  gang_triggered = false;
+  gang_mode = true;
+  writeChannelEnable(gang_bitmap);
+  gang_last_scan = millis();
+  startCTSUmeasure();
+  return true;
+}
+
+bool touchGangActive()
+{
+  return gang_mode;
+}
+
+bool touchGangTriggered()
+{
+  bool ret = gang_triggered;
+  gang_triggered = false;
+  return ret;
+}
+
+uint32_t touchGangRead()
+{
+  return gang_value;
+}
+
+void serviceTouchGang()
+{
+  if (gang_mode && ctsu_done && (millis() - gang_last_scan >= gang_interval))
+  {
+    gang_last_scan = millis();
+    startCTSUmeasure();
+  }
+}
+
+static void resetDiagnostics()
+{
+  for (int i = 0; i < NUM_CTSU_PINS; i++)
+  {
+    diag_faults[i] = CTSU_FAULT_NONE;
+    diag_reported[i] = CTSU_FAULT_NONE;
+    diag_last[i] = 0;
+    diag_same_count[i] = 0;
+  }
+  diag_unit_faults = CTSU_FAULT_NONE;
+}
+
+static void latchUnitFaults(const uint8_t faults)
+{
+  diag_unit_faults |= faults;
+}
+
+// Checks the last frame of results against the limits.  A channel is stuck
+// once its count has come back exactly the same stuckLimit frames in a row.
+static void checkTouchFrame(const uint16_t stuckLimit)
+{
+  for (int i = 0; i < num_configured_sensors; i++)
+  {
+    uint16_t sc = results[i][0];
+    uint16_t rc = results[i][1];
+    uint8_t faults = 0;
+    if (sc < diag_limits.min_count)
+    {
+      faults |= CTSU_FAULT_COUNT_LOW;
+    }
+    if (sc > diag_limits.max_count)
+    {
+      faults |= CTSU_FAULT_COUNT_HIGH;
+    }
+    // ratio is sensor / reference in 1/256ths
+    uint32_t ratio = (rc == 0) ? UINT32_MAX : (((uint32_t)sc << 8) / rc);
+    if ((ratio < diag_limits.min_ratio) || (ratio > diag_limits.max_ratio))
+    {
+      faults |= CTSU_FAULT_RATIO;
+    }
+    if (sc == diag_last[i])
+    {
+      if (diag_same_count[i] < stuckLimit)
+      {
+        diag_same_count[i]++;
+      }
+    }
+    else
+    {
+      diag_same_count[i] = 0;
+    }
+    diag_last[i] = sc;
+    if ((stuckLimit > 0) && (diag_same_count[i] >= stuckLimit))
+    {
+      faults |= CTSU_FAULT_STUCK;
+    }
+    diag_faults[i] |= faults;
+  }
+}
+
+void enableTouchDiagnostics(const bool en)
+{
+  diag_enabled = en;
+}
+
+void setTouchDiagLimits(const ctsu_diag_limits_t &limits)
+{
+  diag_limits = limits;
+}
+
+ctsu_diag_limits_t getTouchDiagLimits()
+{
+  return diag_limits;
+}
+
+uint8_t getTouchPinHealth(const uint8_t pin)
+{
+  if ((pin >= NUM_ARDUINO_PINS) || (pinToDataIndex[pin] == NOT_A_TOUCH_PIN))
+  {
+    return CTSU_FAULT_NONE;
+  }
+  return diag_faults[pinToDataIndex[pin]] | diag_unit_faults;
+}
+
+void clearTouchFaults()
+{
+  noInterrupts();
+  resetDiagnostics();
+  interrupts();
+}
+
+void attachTouchFaultCallback(fn_fault_callback_ptr_t cb)
+{
+  diag_fault_callback = cb;
+}
+
+uint8_t runTouchSelfTest(const uint8_t frames)
+{
+  if (num_configured_sensors == 0)
+  {
+    return CTSU_FAULT_NONE;
+  }
+  stopTouchMeasurement();
+  clearTouchFaults();
+  if (waitForTouchReady())
+  {
+    // Over a short test, every frame coming back the same counts as stuck.
+    // Too few frames can't tell a stuck pad from a quiet one, so the
+    // check is skipped below CTSU_SELFTEST_MIN_STUCK_FRAMES repeats.
+    uint16_t stuckLimit = (frames > 0) ? frames - 1 : 0;
+    if ((diag_limits.stuck_frames > 0) && (diag_limits.stuck_frames < stuckLimit))
+    {
+      stuckLimit = diag_limits.stuck_frames;
+    }
+    if (stuckLimit < CTSU_SELFTEST_MIN_STUCK_FRAMES)
+    {
+      stuckLimit = 0;
+    }
+    ctsu_warming_up = true;
+    for (int f = 0; f < frames; f++)
+    {
+      if (!scanAndWait(millis(), diag_limits.scan_timeout_ms))
+      {
+        latchUnitFaults(CTSU_FAULT_TIMEOUT);
+        break;
+      }
+      checkTouchFrame(stuckLimit);
+    }
+    ctsu_warming_up = false;
+  }
+  uint8_t ret = diag_unit_faults;
+  for (int i = 0; i < num_configured_sensors; i++)
+  {
+    ret |= diag_faults[i];
+  }
+  // the stuck counts from the test don't carry over to background checks
+  for (int i = 0; i < NUM_CTSU_PINS; i++)
+  {
+    diag_same_count[i] = 0;
+  }
+  return ret;
+}
+
+void serviceTouchDiagnostics()
+{
+  if (!diag_enabled)
+  {
+    return;
+  }
+  if (ctsu_scan_active && (millis() - ctsu_scan_start > diag_limits.scan_timeout_ms))
+  {
+    latchUnitFaults(CTSU_FAULT_TIMEOUT);
+  }
+  if (!diag_fault_callback)
+  {
+    return;
+  }
+  for (int pin = 0; pin < NUM_ARDUINO_PINS; pin++)
+  {
+    uint8_t di = pinToDataIndex[pin];
+    if (di == NOT_A_TOUCH_PIN)
+    {
+      continue;
+    }
+    uint8_t newFaults = (diag_faults[di] | diag_unit_faults) & ~diag_reported[di];
+    if (newFaults)
+    {
+      diag_reported[di] |= newFaults;
+      diag_fault_callback(pin, newFaults);
+    }
+  }
+}
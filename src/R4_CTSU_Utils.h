@@ -38,7 +38,20 @@ R4_CTSU_Utils.h  --  Backing functions for the TouchSensor class
 #endif
 #define NOT_A_TOUCH_PIN 255
 
+// Upper bound on the wait for the CTSU to settle after power on.
+#define CTSU_READY_TIMEOUT_MS 100
+
+#define MAX_CTSU_CALLBACKS 8
+
 typedef void (*fn_callback_ptr_t)();
+typedef void (*fn_ctx_callback_ptr_t)(void *);
+typedef void (*fn_fault_callback_ptr_t)(uint8_t, uint8_t);
+
+typedef enum e_ctsu_callback_mode
+{
+  CTSU_CALLBACK_IMMEDIATE = 0, // run in the CTSU_FN interrupt
+  CTSU_CALLBACK_DEFERRED = 1   // run from serviceTouchCallbacks()
+} ctsu_callback_mode_t;
 
 typedef enum e_ctsu_ico_gain
 {
@@ -91,6 +104,35 @@ struct ctsu_pin_info_t
   uint8_t chac_val;
 };
 
+// Fault bits for the channel health status
+typedef enum e_ctsu_fault
+{
+  CTSU_FAULT_NONE = 0x00,
+  CTSU_FAULT_COUNT_LOW = 0x01,  // sensor count below min_count
+  CTSU_FAULT_COUNT_HIGH = 0x02, // sensor count above max_count
+  CTSU_FAULT_RATIO = 0x04,      // sensor / reference outside limits
+  CTSU_FAULT_STUCK = 0x08,      // sensor count stopped changing
+  CTSU_FAULT_TIMEOUT = 0x10,    // scan never finished
+  CTSU_FAULT_UNSTABLE = 0x20    // unit never settled after power on
+} ctsu_fault_t;
+
+#define CTSU_DIAG_DEFAULT_MIN_COUNT 10
+#define CTSU_DIAG_DEFAULT_MAX_COUNT 65000
+#define CTSU_DIAG_DEFAULT_MIN_RATIO 16   // 1/16
+#define CTSU_DIAG_DEFAULT_MAX_RATIO 4096 // 16
+#define CTSU_DIAG_DEFAULT_STUCK_FRAMES 50
+#define CTSU_DIAG_DEFAULT_SCAN_TIMEOUT_MS 100
+
+struct ctsu_diag_limits_t
+{
+  uint16_t min_count;
+  uint16_t max_count;
+  uint16_t min_ratio; // sensor / reference in 1/256ths
+  uint16_t max_ratio;
+  uint16_t stuck_frames; // 0 turns off the stuck check
+  uint32_t scan_timeout_ms;
+};
+
 struct ctsu_pin_settings_t
 {
   ctsu_clock_div_t div;
@@ -104,7 +146,11 @@ void stopTouchMeasurement();
 
 void startTouchMeasurement(bool fr = true);
 bool touchMeasurementReady();
+bool waitForTouchMeasurement();
+bool waitForTouchReady(const uint32_t timeout_ms = CTSU_READY_TIMEOUT_MS);
 bool setTouchMode(const uint8_t);
+bool isTouchModePin(const uint8_t);
+bool clearTouchMode(const uint8_t);
 uint16_t touchRead(const uint8_t);
 uint16_t touchReadReference(const uint8_t);
 
@@ -117,5 +163,27 @@ void applyTouchPinSettings(const uint8_t, const ctsu_pin_settings_t &);
 ctsu_pin_settings_t getTouchPinSettings(const uint8_t);
 
 void attachMeasurementEndCallback(fn_callback_ptr_t);
+bool addMeasurementEndCallback(fn_ctx_callback_ptr_t, void *, const ctsu_callback_mode_t);
+bool removeMeasurementEndCallback(fn_ctx_callback_ptr_t, void *);
+void serviceTouchCallbacks();
+
+bool setTouchGangPins(const uint8_t *, const uint8_t);
+void setTouchGangSettings(const ctsu_pin_settings_t &);
+void setTouchGangThreshold(const uint32_t);
+void setTouchGangInterval(const uint32_t);
+bool startTouchGangScan();
+bool touchGangActive();
+bool touchGangTriggered();
+uint32_t touchGangRead();
+void serviceTouchGang();
+
+void enableTouchDiagnostics(const bool);
+void setTouchDiagLimits(const ctsu_diag_limits_t &);
+ctsu_diag_limits_t getTouchDiagLimits();
+uint8_t getTouchPinHealth(const uint8_t);
+void clearTouchFaults();
+void attachTouchFaultCallback(fn_fault_callback_ptr_t);
+uint8_t runTouchSelfTest(const uint8_t frames = 8);
+void serviceTouchDiagnostics();
 
 #endif // R4_TOUCH_UTILS_H
\ No newline at end of file
@@ -19,12 +19,40 @@ R4_Touch.cpp  --  Capacitive Touch Sensing for Arduino UNO-R4
      */
 
 #include "R4_Touch.h"
+#include <EEPROM.h>
+
+// CRC-16/CCITT over everything in the saved config before the crc field
+static uint16_t configCRC(const touch_config_t &cfg)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&cfg);
+    size_t len = offsetof(touch_config_t, crc);
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)p[i] << 8;
+        for (int b = 0; b < 8; b++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
 
 bool TouchSensor::begin(const uint8_t pin, const uint16_t threshold)
 {
+    if (!setTouchMode(pin))
+    {
+        // leave the sensor as it was
+        return false;
+    }
     _pin = pin;
     _threshold = threshold;
-    return setTouchMode(_pin);
+    return true;
+}
+bool TouchSensor::end()
+{
+    detachSensorCallback();
+    return clearTouchMode(_pin);
 }
 bool TouchSensor::read() { return (touchRead(_pin) > _threshold); }
 uint16_t TouchSensor::readRaw() { return touchRead(_pin); }
@@ -46,7 +74,152 @@ void TouchSensor::stop() { stopTouchMeasurement(); }
 void TouchSensor::startSingle()
 {
     startTouchMeasurement(false);
-    while (!touchMeasurementReady())
-        ;
+    // gives up after scan_timeout_ms and latches CTSU_FAULT_TIMEOUT
+    waitForTouchMeasurement();
+}
+void TouchSensor::attachCallback(fn_callback_ptr_t cb) { attachMeasurementEndCallback(cb); };
+bool TouchSensor::addCallback(fn_ctx_callback_ptr_t cb, void *ctx, const ctsu_callback_mode_t mode) { return addMeasurementEndCallback(cb, ctx, mode); }
+bool TouchSensor::removeCallback(fn_ctx_callback_ptr_t cb, void *ctx) { return removeMeasurementEndCallback(cb, ctx); }
+void TouchSensor::service()
+{
+    serviceTouchGang();
+    serviceTouchDiagnostics();
+    serviceTouchCallbacks();
+}
+
+bool TouchSensor::setGang(TouchSensor *sensors, const uint8_t n)
+{
+    if (n > NUM_CTSU_PINS)
+    {
+        return false;
+    }
+    uint8_t pins[NUM_CTSU_PINS];
+    for (int i = 0; i < n; i++)
+    {
+        pins[i] = sensors[i]._pin;
+    }
+    return setTouchGangPins(pins, n);
+}
+void TouchSensor::setGangSettings(const ctsu_pin_settings_t s) { setTouchGangSettings(s); }
+void TouchSensor::setGangThreshold(const uint32_t t) { setTouchGangThreshold(t); }
+void TouchSensor::setGangInterval(const uint32_t ms) { setTouchGangInterval(ms); }
+bool TouchSensor::startGang() { return startTouchGangScan(); }
+bool TouchSensor::gangActive() { return touchGangActive(); }
+bool TouchSensor::gangTriggered() { return touchGangTriggered(); }
+uint32_t TouchSensor::readGang() { return touchGangRead(); }
+
+uint8_t TouchSensor::getHealth() { return getTouchPinHealth(_pin); }
+void TouchSensor::enableDiagnostics(const bool en) { enableTouchDiagnostics(en); }
+void TouchSensor::setDiagLimits(const ctsu_diag_limits_t l) { setTouchDiagLimits(l); }
+ctsu_diag_limits_t TouchSensor::getDiagLimits() { return getTouchDiagLimits(); }
+void TouchSensor::clearFaults() { clearTouchFaults(); }
+void TouchSensor::attachFaultCallback(fn_fault_callback_ptr_t cb) { attachTouchFaultCallback(cb); }
+uint8_t TouchSensor::selfTest(const uint8_t frames) { return runTouchSelfTest(frames); }
+
+void TouchSensor::sensorCallbackHandler(void *ctx)
+{
+    TouchSensor *sensor = static_cast<TouchSensor *>(ctx);
+    touch_sensor_callback_t cb = sensor->_callback;
+    if (cb)
+    {
+        cb(*sensor, sensor->_callbackCtx);
+    }
+}
+
+bool TouchSensor::attachSensorCallback(touch_sensor_callback_t cb, void *ctx, const ctsu_callback_mode_t mode)
+{
+    // an immediate registration may already be live in the ISR
+    noInterrupts();
+    _callbackCtx = ctx;
+    _callback = cb;
+    interrupts();
+    // the registry entry is keyed on this object
+    if (!addMeasurementEndCallback(sensorCallbackHandler, this, mode))
+    {
+        // registry is full
+        _callback = nullptr;
+        _callbackCtx = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void TouchSensor::detachSensorCallback()
+{
+    removeMeasurementEndCallback(sensorCallbackHandler, this);
+    _callback = nullptr;
+}
+
+bool TouchSensor::saveConfig(TouchSensor *sensors, const uint8_t n, const int address)
+{
+    if ((n > NUM_CTSU_PINS) || (address < 0) || (address + (int)TOUCH_CONFIG_SIZE > (int)EEPROM.length()))
+    {
+        return false;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (!isTouchModePin(sensors[i]._pin))
+        {
+            // sensor was never started with begin()
+            return false;
+        }
+    }
+    touch_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.magic = TOUCH_CONFIG_MAGIC;
+    cfg.version = TOUCH_CONFIG_VERSION;
+    cfg.num_sensors = n;
+    for (int i = 0; i < n; i++)
+    {
+        ctsu_pin_settings_t settings = sensors[i].getPinSettings();
+        cfg.records[i].pin = sensors[i]._pin;
+        cfg.records[i].div = settings.div;
+        cfg.records[i].gain = settings.gain;
+        cfg.records[i].ref_current = settings.ref_current;
+        cfg.records[i].offset = settings.offset;
+        cfg.records[i].count = settings.count;
+        cfg.records[i].threshold = sensors[i]._threshold;
+    }
+    cfg.crc = configCRC(cfg);
+    EEPROM.put(address, cfg);
+    return true;
+}
+
+uint8_t TouchSensor::loadConfig(TouchSensor *sensors, const uint8_t n, const int address)
+{
+    if ((address < 0) || (address + (int)TOUCH_CONFIG_SIZE > (int)EEPROM.length()))
+    {
+        return 0;
+    }
+    touch_config_t cfg;
+    EEPROM.get(address, cfg);
+    if ((cfg.magic != TOUCH_CONFIG_MAGIC) || (cfg.version != TOUCH_CONFIG_VERSION) ||
+        (cfg.num_sensors > NUM_CTSU_PINS) || (cfg.crc != configCRC(cfg)))
+    {
+        // nothing saved, old format, or corrupted
+        return 0;
+    }
+    uint8_t restored = 0;
+    for (int i = 0; (i < cfg.num_sensors) && (i < n); i++)
+    {
+        const touch_config_record_t &rec = cfg.records[i];
+        if (isTouchModePin(rec.pin) || !sensors[i].begin(rec.pin, rec.threshold))
+        {
+            // pin is already in use by another sensor or isn't a touch pin
+            continue;
+        }
+        ctsu_pin_settings_t settings;
+        settings.div = static_cast<ctsu_clock_div_t>(rec.div);
+        settings.gain = static_cast<ctsu_ico_gain_t>(rec.gain);
+        settings.ref_current = rec.ref_current;
+        settings.offset = rec.offset;
+        settings.count = rec.count;
+        sensors[i].applyPinSettings(settings);
+        restored++;
+    }
+    if (restored)
+    {
+        waitForTouchReady();
+    }
+    return restored;
 }
-void TouchSensor::attachCallback(fn_callback_ptr_t cb) { attachMeasurementEndCallback(cb); };
\ No newline at end of file
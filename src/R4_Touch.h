@@ -30,14 +30,50 @@ R4_Touch.h  --  Capacitive Touch Sensing for Arduino UNO-R4
 
 #define DEFAULT_TOUCH_THRESHOLD 19000
 
+// Saved configuration in the data flash (EEPROM)
+#define TOUCH_CONFIG_MAGIC 0x5254 // "RT"
+#define TOUCH_CONFIG_VERSION 1
+#define TOUCH_CONFIG_DEFAULT_ADDRESS 0
+
+struct touch_config_record_t
+{
+  uint8_t pin;
+  uint8_t div;
+  uint8_t gain;
+  uint8_t ref_current;
+  uint16_t offset;
+  uint8_t count;
+  uint8_t reserved;
+  uint16_t threshold;
+};
+
+struct touch_config_t
+{
+  uint16_t magic;
+  uint8_t version;
+  uint8_t num_sensors;
+  touch_config_record_t records[NUM_CTSU_PINS];
+  uint16_t crc;
+};
+
+#define TOUCH_CONFIG_SIZE (sizeof(touch_config_t))
+
+class TouchSensor;
+typedef void (*touch_sensor_callback_t)(TouchSensor &, void *);
+
 class TouchSensor
 {
 private:
-  uint8_t _pin;
+  uint8_t _pin = NOT_A_TOUCH_PIN;
   uint16_t _threshold;
+  touch_sensor_callback_t _callback = nullptr;
+  void *_callbackCtx = nullptr;
+
+  static void sensorCallbackHandler(void *);
 
 public:
   bool begin(const uint8_t aPin, const uint16_t aThresh);
+  bool end();
   bool read();
   uint16_t readRaw();
   uint16_t readReference();
@@ -57,6 +93,32 @@ public:
   static void stop();
   static void startSingle();
   static void attachCallback(fn_callback_ptr_t cb);
+  static bool addCallback(fn_ctx_callback_ptr_t cb, void *ctx = nullptr, const ctsu_callback_mode_t mode = CTSU_CALLBACK_DEFERRED);
+  static bool removeCallback(fn_ctx_callback_ptr_t cb, void *ctx = nullptr);
+  static void service();
+
+  static bool setGang(TouchSensor *sensors, const uint8_t n);
+  static void setGangSettings(const ctsu_pin_settings_t s);
+  static void setGangThreshold(const uint32_t t);
+  static void setGangInterval(const uint32_t ms);
+  static bool startGang();
+  static bool gangActive();
+  static bool gangTriggered();
+  static uint32_t readGang();
+
+  uint8_t getHealth();
+  static void enableDiagnostics(const bool en = true);
+  static void setDiagLimits(const ctsu_diag_limits_t l);
+  static ctsu_diag_limits_t getDiagLimits();
+  static void clearFaults();
+  static void attachFaultCallback(fn_fault_callback_ptr_t cb);
+  static uint8_t selfTest(const uint8_t frames = 8);
+
+  bool attachSensorCallback(touch_sensor_callback_t cb, void *ctx = nullptr, const ctsu_callback_mode_t mode = CTSU_CALLBACK_DEFERRED);
+  void detachSensorCallback();
+
+  static bool saveConfig(TouchSensor *sensors, const uint8_t n, const int address = TOUCH_CONFIG_DEFAULT_ADDRESS);
+  static uint8_t loadConfig(TouchSensor *sensors, const uint8_t n, const int address = TOUCH_CONFIG_DEFAULT_ADDRESS);
 };
 
 #endif // R4_TOUCH_H